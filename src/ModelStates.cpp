@@ -0,0 +1,98 @@
+/*
+ * ModelStates.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <vizkit3d_world/ModelStates.hpp>
+
+namespace vizkit3d_world {
+
+const size_t ModelStates::INVALID_ID = static_cast<size_t>(-1);
+
+size_t ModelStates::addModel(std::string name, base::Position position, base::Orientation orientation) {
+    size_t id = names.size();
+
+    if (!ids.insert(std::make_pair(name, id)).second) {
+        throw std::invalid_argument("the model " + name + " already exists");
+    }
+
+    names.push_back(name);
+    positions.push_back(position);
+    orientations.push_back(orientation);
+    jointPositions.push_back(std::vector<double>());
+
+    return id;
+}
+
+size_t ModelStates::getId(std::string name) const {
+    std::map<std::string, size_t>::const_iterator it = ids.find(name);
+    return (it == ids.end()) ? INVALID_ID : it->second;
+}
+
+void ModelStates::clear() {
+    names.clear();
+    positions.clear();
+    orientations.clear();
+    jointPositions.clear();
+    ids.clear();
+}
+
+void ModelStates::checkId(size_t id) const {
+    if (id >= names.size()) {
+        throw std::out_of_range("invalid model id");
+    }
+}
+
+void ModelStates::setPose(size_t id, const base::Position& position, const base::Orientation& orientation) {
+    checkId(id);
+    positions[id] = position;
+    orientations[id] = orientation;
+}
+
+void ModelStates::setPoses(const std::vector<base::Position>& positions, const std::vector<base::Orientation>& orientations) {
+    if (positions.size() != names.size() || orientations.size() != names.size()) {
+        throw std::invalid_argument("the number of poses must be equal to the number of models");
+    }
+
+    //the arrays have the same size, so the copy does not allocate
+    std::copy(positions.begin(), positions.end(), this->positions.begin());
+    std::copy(orientations.begin(), orientations.end(), this->orientations.begin());
+}
+
+void ModelStates::setJointPositions(size_t id, const base::samples::Joints& joints) {
+    checkId(id);
+
+    std::vector<double>& values = jointPositions[id];
+    values.resize(joints.elements.size());
+
+    for (size_t i = 0; i < joints.elements.size(); i++) {
+        values[i] = joints.elements[i].position;
+    }
+}
+
+size_t ModelStates::memoryUsage() const {
+    size_t bytes = names.capacity() * sizeof(std::string) +
+                   positions.capacity() * sizeof(base::Position) +
+                   orientations.capacity() * sizeof(base::Orientation) +
+                   jointPositions.capacity() * sizeof(std::vector<double>);
+
+    for (size_t i = 0; i < names.size(); i++) {
+        bytes += names[i].capacity();
+        bytes += jointPositions[i].capacity() * sizeof(double);
+    }
+
+    /**
+     * each map node stores the key and the id plus the color and three pointers
+     */
+    for (std::map<std::string, size_t>::const_iterator it = ids.begin(); it != ids.end(); it++) {
+        bytes += sizeof(std::map<std::string, size_t>::value_type) + 4 * sizeof(void*);
+        bytes += it->first.capacity();
+    }
+
+    return bytes;
+}
+
+}
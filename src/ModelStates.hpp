@@ -0,0 +1,111 @@
+/*
+ * ModelStates.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef GUI_VIZKIT3D_WORLD_SRC_MODELSTATES_HPP_
+#define GUI_VIZKIT3D_WORLD_SRC_MODELSTATES_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <base/Pose.hpp>
+#include <base/samples/Joints.hpp>
+
+namespace vizkit3d_world {
+
+/**
+ * ModelStates
+ * stores the state of each model in dense arrays indexed by the model id
+ * the model name is only used to find the model id
+ */
+class ModelStates {
+public:
+
+    /**
+     * id returned when the model name is not found
+     */
+    static const size_t INVALID_ID;
+
+    /**
+     * Add a model to the end of the arrays
+     *
+     * @param name: the model name
+     * @param position: the model position in the world
+     * @param orientation: the model orientation in the world
+     * @return size_t: the model id
+     */
+    size_t addModel(std::string name, base::Position position, base::Orientation orientation);
+
+    /**
+     * Return the model id by name
+     *
+     * @param name: the model name
+     * @return size_t: the model id or INVALID_ID if the model is not found
+     */
+    size_t getId(std::string name) const;
+
+    /**
+     * @return size_t: the number of models
+     */
+    size_t size() const { return names.size(); }
+
+    /**
+     * Remove all models
+     */
+    void clear();
+
+    /**
+     * @return size_t: the number of bytes allocated by the arrays and the name map
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * set the model pose in the world
+     *
+     * @param id: the model id
+     * @param position: the model position
+     * @param orientation: the model orientation
+     */
+    void setPose(size_t id, const base::Position& position, const base::Orientation& orientation);
+
+    /**
+     * set the pose in the world of every model
+     *
+     * @param positions: the positions indexed by the model id
+     * @param orientations: the orientations indexed by the model id
+     */
+    void setPoses(const std::vector<base::Position>& positions, const std::vector<base::Orientation>& orientations);
+
+    /**
+     * set the joints positions of a model
+     * the joints vector of the model is reused, so it only allocates when the number of joints grows
+     *
+     * @param id: the model id
+     * @param joints: the joints states
+     */
+    void setJointPositions(size_t id, const base::samples::Joints& joints);
+
+    const std::string& getName(size_t id) const { return names[id]; }
+    const std::vector<std::string>& getNames() const { return names; }
+    const std::vector<base::Position>& getPositions() const { return positions; }
+    const std::vector<base::Orientation>& getOrientations() const { return orientations; }
+    const std::vector<double>& getJointPositions(size_t id) const { return jointPositions[id]; }
+
+private:
+
+    void checkId(size_t id) const;
+
+    std::vector<std::string> names; //model names
+    std::vector<base::Position> positions; //model positions in the world
+    std::vector<base::Orientation> orientations; //model orientations in the world
+    std::vector<std::vector<double> > jointPositions; //last joints positions of each model
+
+    std::map<std::string, size_t> ids; //map the model name to the model id
+
+};
+
+}
+
+#endif /* GUI_VIZKIT3D_WORLD_SRC_MODELSTATES_HPP_ */
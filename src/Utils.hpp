@@ -3,6 +3,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include <QtGui/QImage>
 #include <base/samples/Frame.hpp>
 #include <boost/thread/thread.hpp>
@@ -46,7 +49,7 @@ inline base::samples::frame::frame_mode_t toFrameMode(QImage::Format format) {
             base::samples::frame::MODE_GRAYSCALE,
             base::samples::frame::MODE_RGB32,
             base::samples::frame::MODE_RGB32,
-            base::samples::frame::MODE_BGR,
+            base::samples::frame::MODE_RGB,
             base::samples::frame::MODE_UNDEFINED
     };
 
@@ -67,33 +70,38 @@ inline base::samples::frame::frame_mode_t toFrameMode(QImage::Format format) {
  * @param src: the source image
  * @param dst: the destionation image
  * @param flipImage: if is true, flip image in vertical direction
+ * @param rect: the region of src that will be copied, a null rect copies the whole image
  */
-inline void cpyQImageToFrame(const QImage& src, base::samples::frame::Frame& dst, bool flipImage = false)
+inline void cpyQImageToFrame(const QImage& src, base::samples::frame::Frame& dst, bool flipImage = false, QRect rect = QRect())
 {
+    if (rect.isNull()) rect = src.rect();
+
     /**
      * The number of bytes of QImage rows must be multiple of 4.
      * QImage width * number of channels is always multiple of 4.
      */
-    int bytesPerPixel = src.bitPlaneCount() >> 3;
-    int rowCount = src.width() * bytesPerPixel;
+    int bytesPerPixel = src.depth() >> 3;
+    int rowCount = rect.width() * bytesPerPixel;
 
     /**
-     * if rowCount is equal to src.bytesPerLine and flipImage is false, just copy the src.bits to dst frame
+     * if the whole image is copied, rowCount is equal to src.bytesPerLine and flipImage is false,
+     * just copy the src.bits to dst frame
      */
-    if (rowCount == src.bytesPerLine() && !flipImage) {
+    if (rect == src.rect() && rowCount == src.bytesPerLine() && !flipImage) {
         dst.setImage(src.bits(), src.byteCount());
     }
     else {
         //resize image buffer
-        dst.image.resize(src.height() * rowCount);
+        dst.image.resize(rect.height() * rowCount);
         //get pointer to Frame image buffer
         uint8_t *dstbits = static_cast<uchar *>(&dst.image[0]);
-        //get pointer to QImage image buffer
-        const uint8_t *srcbits = reinterpret_cast<const uint8_t*>(src.bits());
+        //get pointer to the first pixel of the region in QImage image buffer
+        const uint8_t *srcbits = reinterpret_cast<const uint8_t*>(src.bits()) +
+                                 rect.y() * src.bytesPerLine() + rect.x() * bytesPerPixel;
 
-        //copy each line from source image to frame image
-        for (int y = 0; y < src.height(); y++){
-            int offset = (flipImage) ? ((src.height() - y - 1) * rowCount) : y * rowCount;
+        //copy each line from source region to frame image
+        for (int y = 0; y < rect.height(); y++){
+            int offset = (flipImage) ? ((rect.height() - y - 1) * rowCount) : y * rowCount;
             memcpy(dstbits + offset, srcbits + y * src.bytesPerLine(), rowCount);
         }
     }
@@ -101,42 +109,442 @@ inline void cpyQImageToFrame(const QImage& src, base::samples::frame::Frame& dst
 }
 
 /**
- * Convert QImage to base::samples::frame::Frame
+ * Pixel readers used by the conversion kernels
+ */
+struct Rgb32PixelReader {
+    static inline void read(const uint8_t* row, int x, uint8_t& r, uint8_t& g, uint8_t& b, uint8_t& a) {
+        QRgb value = reinterpret_cast<const QRgb*>(row)[x];
+        r = qRed(value);
+        g = qGreen(value);
+        b = qBlue(value);
+        a = qAlpha(value);
+    }
+};
+
+struct Rgb24PixelReader {
+    static inline void read(const uint8_t* row, int x, uint8_t& r, uint8_t& g, uint8_t& b, uint8_t& a) {
+        r = row[x * 3];
+        g = row[x * 3 + 1];
+        b = row[x * 3 + 2];
+        a = 0xff;
+    }
+};
+
+struct Gray8PixelReader {
+    static inline void read(const uint8_t* row, int x, uint8_t& r, uint8_t& g, uint8_t& b, uint8_t& a) {
+        r = g = b = row[x];
+        a = 0xff;
+    }
+};
+
+struct Rgba8PixelReader {
+    static inline void read(const uint8_t* row, int x, uint8_t& r, uint8_t& g, uint8_t& b, uint8_t& a) {
+        r = row[x * 4];
+        g = row[x * 4 + 1];
+        b = row[x * 4 + 2];
+        a = row[x * 4 + 3];
+    }
+};
+
+/**
+ * Return true if the frame mode is a bayer pattern
  *
- * @param src: QImage with source pixels
- * @param dst: base::samples::frame::Frame which receives pixels
- * @param flipImage: if is true, then flip image in vertical direction
+ * @param mode: the frame mode
  */
-inline void cvtQImageToFrame(const QImage& src, base::samples::frame::Frame& dst, bool flipImage = false) {
+inline bool isBayerMode(base::samples::frame::frame_mode_t mode) {
+    return mode == base::samples::frame::MODE_BAYER ||
+           mode == base::samples::frame::MODE_BAYER_RGGB ||
+           mode == base::samples::frame::MODE_BAYER_GRBG ||
+           mode == base::samples::frame::MODE_BAYER_BGGR ||
+           mode == base::samples::frame::MODE_BAYER_GBRG;
+}
 
-    base::samples::frame::frame_mode_t mode = toFrameMode(src.format());
+/**
+ * Return the channel (0: red, 1: green, 2: blue) sampled by a bayer pattern
+ *
+ * @param mode: the bayer frame mode
+ * @param x: the pixel column
+ * @param y: the pixel row
+ * @return int: the channel index
+ */
+inline int bayerChannel(base::samples::frame::frame_mode_t mode, int x, int y) {
+    /**
+     * the 2x2 pattern of each mode stored row by row
+     */
+    static const int rggb[] = { 0, 1, 1, 2 };
+    static const int grbg[] = { 1, 0, 2, 1 };
+    static const int bggr[] = { 2, 1, 1, 0 };
+    static const int gbrg[] = { 1, 2, 0, 1 };
 
-    if (mode == base::samples::frame::MODE_UNDEFINED){
-        throw std::runtime_error("Unable convert QImage to base::samples::frame::Frame (unsupported image mode).");
+    int cell = ((y & 1) << 1) | (x & 1);
+
+    switch (mode)
+    {
+        case base::samples::frame::MODE_BAYER_RGGB: return rggb[cell];
+        case base::samples::frame::MODE_BAYER_GRBG: return grbg[cell];
+        case base::samples::frame::MODE_BAYER_BGGR: return bggr[cell];
+        case base::samples::frame::MODE_BAYER_GBRG: return gbrg[cell];
+        default:
+            throw std::runtime_error("Unable convert QImage to base::samples::frame::Frame (unsupported bayer mode).");
     }
+}
+
+/**
+ * Convert one image row to the requested frame mode in a single pass
+ *
+ * @param src: the source row
+ * @param dst: the destination row
+ * @param width: the number of pixels in the row
+ * @param mode: the destination frame mode
+ * @param y: the destination row index, used by the bayer patterns
+ */
+template <typename PixelReader>
+inline void cvtRow(const uint8_t* src, uint8_t* dst, int width, base::samples::frame::frame_mode_t mode, int y)
+{
+    uint8_t r, g, b, a;
 
     switch (mode)
     {
+        case base::samples::frame::MODE_RGB:
+            for (int x = 0; x < width; x++) {
+                PixelReader::read(src, x, r, g, b, a);
+                dst[x * 3] = r; dst[x * 3 + 1] = g; dst[x * 3 + 2] = b;
+            }
+            break;
+        case base::samples::frame::MODE_BGR:
+            for (int x = 0; x < width; x++) {
+                PixelReader::read(src, x, r, g, b, a);
+                dst[x * 3] = b; dst[x * 3 + 1] = g; dst[x * 3 + 2] = r;
+            }
+            break;
         case base::samples::frame::MODE_RGB32:
+            for (int x = 0; x < width; x++) {
+                PixelReader::read(src, x, r, g, b, a);
+                dst[x * 4] = r; dst[x * 4 + 1] = g; dst[x * 4 + 2] = b; dst[x * 4 + 3] = a;
+            }
+            break;
+        case base::samples::frame::MODE_GRAYSCALE:
+            for (int x = 0; x < width; x++) {
+                PixelReader::read(src, x, r, g, b, a);
+                //ITU-R BT.601 luma with 8 bits fixed point weights
+                dst[x] = uint8_t((77 * r + 150 * g + 29 * b + 128) >> 8);
+            }
+            break;
+        case base::samples::frame::MODE_BAYER_RGGB:
+        case base::samples::frame::MODE_BAYER_GRBG:
+        case base::samples::frame::MODE_BAYER_BGGR:
+        case base::samples::frame::MODE_BAYER_GBRG:
         {
-            /**
-             * In image processing it is not necessary the alpha channel
-             * If image has 32 bits per pixels, then its is converted to 24 bits, excluding the alpha channel or extra information
-             */
-            QImage rgb24 = src.convertToFormat(QImage::Format_RGB888);
-            dst.init(src.width(), src.height(), 8, base::samples::frame::MODE_BGR, -1);
-            rgb24 = rgb24.rgbSwapped();
-            cpyQImageToFrame(rgb24, dst, flipImage);
+            int channels[] = { bayerChannel(mode, 0, y), bayerChannel(mode, 1, y) };
+            uint8_t rgb[3];
+            for (int x = 0; x < width; x++) {
+                PixelReader::read(src, x, rgb[0], rgb[1], rgb[2], a);
+                dst[x] = rgb[channels[x & 1]];
+            }
         }
         break;
         default:
+            throw std::runtime_error("Unable convert QImage to base::samples::frame::Frame (unsupported frame mode).");
+    }
+}
+
+/**
+ * Add the channels of one source row to the sums of the reduced row
+ * each reduced pixel sums 2^scaleLevels source pixels
+ *
+ * @param src: the source row
+ * @param sum: the r, g, b, a sums of each reduced pixel
+ * @param width: the number of pixels of the reduced row
+ * @param scaleLevels: the reduction is 2^scaleLevels in each direction
+ */
+template <typename PixelReader>
+inline void sumScaledRow(const uint8_t* src, uint32_t* sum, int width, int scaleLevels)
+{
+    uint8_t r, g, b, a;
+    const int srcWidth = width << scaleLevels;
+
+    for (int x = 0; x < srcWidth; x++) {
+        PixelReader::read(src, x, r, g, b, a);
+        uint32_t *s = sum + ((x >> scaleLevels) << 2);
+        s[0] += r; s[1] += g; s[2] += b; s[3] += a;
+    }
+}
+
+/**
+ * Convert QImage to base::samples::frame::Frame reducing the resolution with a box filter
+ * Each source pixel is read once and each frame pixel is written once
+ *
+ * @param src: QImage with source pixels
+ * @param dst: base::samples::frame::Frame which receives pixels
+ * @param srcMode: the frame mode of the QImage format
+ * @param mode: the frame mode of dst
+ * @param flipImage: if is true, then flip image in vertical direction
+ * @param rect: the region of src that will be converted
+ * @param scaleLevels: the reduction is 2^scaleLevels in each direction
+ */
+inline void cvtScaledQImageToFrame(const QImage& src, base::samples::frame::Frame& dst,
+                                   base::samples::frame::frame_mode_t srcMode,
+                                   base::samples::frame::frame_mode_t mode,
+                                   bool flipImage, QRect rect, int scaleLevels) {
+
+    int width = rect.width() >> scaleLevels;
+    int height = rect.height() >> scaleLevels;
+
+    if (width == 0 || height == 0) {
+        throw std::invalid_argument("Unable convert QImage to base::samples::frame::Frame (region is too small for the scale).");
+    }
+
+    dst.init(width, height, 8, mode, -1);
+
+    int factor = 1 << scaleLevels;
+    int shift = 2 * scaleLevels;
+    uint32_t half = (1u << shift) >> 1;
+    int bytesPerPixel = src.depth() >> 3;
+    int rowSize = dst.getRowSize();
+    uint8_t *dstbits = dst.getImagePtr();
+
+    std::vector<uint32_t> sum(width * 4);
+    std::vector<uint8_t> rgba(width * 4);
+
+    for (int y = 0; y < height; y++){
+        std::fill(sum.begin(), sum.end(), 0);
+
+        for (int i = 0; i < factor; i++){
+            int rowY = y * factor + i;
+            int srcY = (flipImage) ? (rect.bottom() - rowY) : (rect.top() + rowY);
+            const uint8_t *srcrow = reinterpret_cast<const uint8_t*>(src.constScanLine(srcY)) + rect.x() * bytesPerPixel;
+
+            switch (srcMode)
+            {
+                case base::samples::frame::MODE_RGB32: sumScaledRow<Rgb32PixelReader>(srcrow, &sum[0], width, scaleLevels); break;
+                case base::samples::frame::MODE_RGB: sumScaledRow<Rgb24PixelReader>(srcrow, &sum[0], width, scaleLevels); break;
+                default: sumScaledRow<Gray8PixelReader>(srcrow, &sum[0], width, scaleLevels); break;
+            }
+        }
+
+        for (size_t i = 0; i < sum.size(); i++) {
+            rgba[i] = uint8_t((sum[i] + half) >> shift);
+        }
+
+        //the bayer mosaic is sampled after the reduction
+        cvtRow<Rgba8PixelReader>(&rgba[0], dstbits + y * rowSize, width, mode, y);
+    }
+}
+
+/**
+ * Convert QImage to base::samples::frame::Frame with the requested frame mode
+ * Each pixel is read and written only once
+ *
+ * @param src: QImage with source pixels
+ * @param dst: base::samples::frame::Frame which receives pixels
+ * @param mode: the frame mode of dst, MODE_RGB, MODE_BGR, MODE_RGB32, MODE_GRAYSCALE or bayer
+ * @param flipImage: if is true, then flip image in vertical direction
+ * @param rect: the region of src that will be converted, a null rect converts the whole image
+ * @param scaleLevels: the resolution of rect is reduced by 2^scaleLevels in each direction
+ */
+inline void cvtQImageToFrame(const QImage& src, base::samples::frame::Frame& dst,
+                             base::samples::frame::frame_mode_t mode,
+                             bool flipImage = false, QRect rect = QRect(), int scaleLevels = 0) {
+
+    base::samples::frame::frame_mode_t srcMode = toFrameMode(src.format());
+
+    if (srcMode == base::samples::frame::MODE_UNDEFINED){
+        throw std::runtime_error("Unable convert QImage to base::samples::frame::Frame (unsupported image mode).");
+    }
+
+    if (rect.isNull()) rect = src.rect();
+
+    if (!src.rect().contains(rect)) {
+        throw std::invalid_argument("Unable convert QImage to base::samples::frame::Frame (region is outside of the image).");
+    }
+
+    if (scaleLevels < 0) {
+        throw std::invalid_argument("Unable convert QImage to base::samples::frame::Frame (the scale levels is negative).");
+    }
+
+    if (scaleLevels > 0) {
+        cvtScaledQImageToFrame(src, dst, srcMode, mode, flipImage, rect, scaleLevels);
+        return;
+    }
+
+    dst.init(rect.width(), rect.height(), 8, mode, -1);
+
+    /**
+     * if the source has the same pixel layout, just copy the pixels
+     * the QImage 32 bits formats store each pixel as a QRgb value, so they are always converted
+     */
+    if (srcMode == mode && srcMode != base::samples::frame::MODE_RGB32) {
+        cpyQImageToFrame(src, dst, flipImage, rect);
+        return;
+    }
+
+    int bytesPerPixel = src.depth() >> 3;
+    int rowSize = dst.getRowSize();
+    uint8_t *dstbits = dst.getImagePtr();
+
+    for (int y = 0; y < rect.height(); y++){
+        int srcY = (flipImage) ? (rect.bottom() - y) : (rect.top() + y);
+        const uint8_t *srcrow = reinterpret_cast<const uint8_t*>(src.constScanLine(srcY)) + rect.x() * bytesPerPixel;
+
+        switch (srcMode)
         {
-            dst.init(src.width(), src.height(), 8, mode, -1);
-            cpyQImageToFrame(src, dst, flipImage);
+            case base::samples::frame::MODE_RGB32:
+                cvtRow<Rgb32PixelReader>(srcrow, dstbits + y * rowSize, rect.width(), mode, y);
+                break;
+            case base::samples::frame::MODE_RGB:
+                cvtRow<Rgb24PixelReader>(srcrow, dstbits + y * rowSize, rect.width(), mode, y);
+                break;
+            default:
+                cvtRow<Gray8PixelReader>(srcrow, dstbits + y * rowSize, rect.width(), mode, y);
+                break;
         }
-        break;
     }
 }
 
+/**
+ * Convert QImage to base::samples::frame::Frame
+ * The frame mode is defined by the QImage format, 32 bits images are converted to MODE_BGR
+ *
+ * @param src: QImage with source pixels
+ * @param dst: base::samples::frame::Frame which receives pixels
+ * @param flipImage: if is true, then flip image in vertical direction
+ * @param rect: the region of src that will be converted, a null rect converts the whole image
+ * @param scaleLevels: the resolution of rect is reduced by 2^scaleLevels in each direction
+ */
+inline void cvtQImageToFrame(const QImage& src, base::samples::frame::Frame& dst, bool flipImage = false, QRect rect = QRect(), int scaleLevels = 0) {
+
+    base::samples::frame::frame_mode_t mode = toFrameMode(src.format());
+
+    /**
+     * In image processing it is not necessary the alpha channel
+     * If image has 32 bits per pixels, then its is converted to 24 bits, excluding the alpha channel or extra information
+     */
+    if (mode == base::samples::frame::MODE_RGB32) {
+        mode = base::samples::frame::MODE_BGR;
+    }
+
+    cvtQImageToFrame(src, dst, mode, flipImage, rect, scaleLevels);
+}
+
+/**
+ * Downsample one image row pair by two in both directions (2x2 box filter)
+ *
+ * The vertical sum is done first in a contiguous buffer and the horizontal sum
+ * uses a compile-time pixel size, so both loops can be vectorized by the compiler.
+ *
+ * @param row0: the first source row
+ * @param row1: the second source row
+ * @param sum: temporary buffer with at least srcWidth * PixelSize elements
+ * @param dst: the destination row
+ * @param dstWidth: the number of pixels of destination row
+ */
+template <int PixelSize>
+inline void downsampleRows(const uint8_t* row0, const uint8_t* row1, uint16_t* sum, uint8_t* dst, int dstWidth)
+{
+    const int srcCount = dstWidth * 2 * PixelSize;
+
+    for (int i = 0; i < srcCount; i++) {
+        sum[i] = uint16_t(row0[i]) + uint16_t(row1[i]);
+    }
+
+    for (int x = 0; x < dstWidth; x++) {
+        const uint16_t *s = sum + x * 2 * PixelSize;
+        for (int c = 0; c < PixelSize; c++) {
+            dst[x * PixelSize + c] = uint8_t((s[c] + s[c + PixelSize] + 2) >> 2);
+        }
+    }
+}
+
+/**
+ * Downsample base::samples::frame::Frame to half resolution
+ *
+ * @param src: the source frame with 8 bits per channel
+ * @param dst: the frame which receives the downsampled pixels
+ */
+inline void downsampleFrame(const base::samples::frame::Frame& src, base::samples::frame::Frame& dst)
+{
+    if (src.getDataDepth() != 8 || src.isBayer() || src.isCompressed()) {
+        throw std::runtime_error("Unable downsample base::samples::frame::Frame (unsupported image mode).");
+    }
+
+    int dstWidth = src.getWidth() / 2;
+    int dstHeight = src.getHeight() / 2;
+
+    if (dstWidth == 0 || dstHeight == 0) {
+        throw std::runtime_error("Unable downsample base::samples::frame::Frame (image is too small).");
+    }
+
+    int pixelSize = src.getPixelSize();
+    dst.init(dstWidth, dstHeight, 8, src.getFrameMode(), -1);
+
+    std::vector<uint16_t> sum(dstWidth * 2 * pixelSize);
+    const uint8_t *srcbits = src.getImageConstPtr();
+    uint8_t *dstbits = dst.getImagePtr();
+    int srcRowSize = src.getRowSize();
+    int dstRowSize = dst.getRowSize();
+
+    for (int y = 0; y < dstHeight; y++) {
+        const uint8_t *row0 = srcbits + (2 * y) * srcRowSize;
+        const uint8_t *row1 = row0 + srcRowSize;
+        uint8_t *dstrow = dstbits + y * dstRowSize;
+
+        switch (pixelSize)
+        {
+            case 1: downsampleRows<1>(row0, row1, &sum[0], dstrow, dstWidth); break;
+            case 3: downsampleRows<3>(row0, row1, &sum[0], dstrow, dstWidth); break;
+            case 4: downsampleRows<4>(row0, row1, &sum[0], dstrow, dstWidth); break;
+            default:
+                throw std::runtime_error("Unable downsample base::samples::frame::Frame (unsupported pixel size).");
+        }
+    }
+
+    dst.copyImageIndependantAttributes(src);
+}
+
+/**
+ * Build an image pyramid from base::samples::frame::Frame
+ * each level has half of the resolution of the previous one
+ *
+ * @param src: the base frame (it is not included in the pyramid)
+ * @param pyramid: receives the downsampled levels
+ * @param levels: the number of levels
+ */
+inline void buildFramePyramid(const base::samples::frame::Frame& src, std::vector<base::samples::frame::Frame>& pyramid, int levels)
+{
+    if (levels < 0) {
+        throw std::invalid_argument("Unable build the image pyramid (the number of levels is negative).");
+    }
+
+    pyramid.resize(levels);
+
+    const base::samples::frame::Frame *previous = &src;
+    for (int i = 0; i < levels; i++) {
+        downsampleFrame(*previous, pyramid[i]);
+        previous = &pyramid[i];
+    }
+}
+
+/**
+ * Return the region of the QImage that contains a region of interest
+ *
+ * @param region: the region of the QImage with the image pixels
+ * @param roi: the region of interest in the image after flip, a null rect means the whole region
+ * @param flipImage: if is true, the QImage rows are stored bottom up
+ * @return QRect: the region of interest in the QImage coordinates
+ */
+inline QRect roiToImageRect(QRect region, QRect roi, bool flipImage)
+{
+    if (roi.isNull()) return region;
+
+    if (!QRect(0, 0, region.width(), region.height()).contains(roi)) {
+        throw std::invalid_argument("the region of interest is outside of the image");
+    }
+
+    /**
+     * when the rows are stored bottom up the roi rows are counted from the bottom of the region
+     */
+    int y = (flipImage) ? region.height() - roi.y() - roi.height() : roi.y();
+    return QRect(region.x() + roi.x(), region.y() + y, roi.width(), roi.height());
+}
 
 #endif /* GUI_VIZKIT3D_WORLD_SRC_UTILS_HPP_ */
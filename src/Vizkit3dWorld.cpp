@@ -13,6 +13,11 @@
 #include <boost/algorithm/string.hpp>
 #include <vizkit3d_world/Vizkit3dWorld.hpp>
 #include <osgViewer/View>
+#include <osg/NodeVisitor>
+#include <osgUtil/CullVisitor>
+#include <osgUtil/Simplifier>
+#include <cfloat>
+#include <set>
 #include <base/Logging.hpp>
 #include "Utils.hpp"
 
@@ -21,6 +26,79 @@ namespace vizkit3d_world {
 static int argc = 1;
 static char *argv[] = { "vizkit3d_world" };
 
+/**
+ * Collect the geodes of a model subtree
+ * the geodes are replaced after the traversal, so the scene graph is not changed while it is visited
+ */
+class GeodeCollector : public osg::NodeVisitor {
+public:
+    GeodeCollector()
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Geode& geode) {
+        geodes.insert(&geode);
+    }
+
+    std::set<osg::Geode*> geodes;
+};
+
+/**
+ * Cull callback attached to the root node of each model
+ * osg calls it only for models inside the camera frustum, so the models
+ * farther than maxDistance are culled here and the drawn models are counted
+ */
+class ModelCullCallback : public osg::NodeCallback {
+public:
+    ModelCullCallback()
+        : enabled(true)
+        , maxDistance(FLT_MAX)
+        , frameNumber(0)
+        , counted(false)
+        , drawnModels(0) {}
+
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv) {
+        osgUtil::CullVisitor *cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+
+        if (cv) {
+            //reset the counter in the first model of each frame
+            unsigned int frame = (cv->getFrameStamp()) ? cv->getFrameStamp()->getFrameNumber() : 0;
+            if (!counted || frame != frameNumber) {
+                frameNumber = frame;
+                counted = true;
+                drawnModels = 0;
+            }
+
+            if (enabled) {
+                //the eye point and the bound are in the coordinates of the model parent
+                const osg::BoundingSphere& bound = node->getBound();
+                if (bound.valid() && (bound.center() - cv->getEyeLocal()).length() - bound.radius() > maxDistance) {
+                    return;
+                }
+            }
+
+            drawnModels++;
+        }
+
+        traverse(node, nv);
+    }
+
+    /**
+     * @param frame: the number of the last rendered frame
+     * @return int: the number of models drawn in the frame
+     */
+    int getDrawnModels(unsigned int frame) const {
+        return (counted && frame == frameNumber) ? drawnModels : 0;
+    }
+
+    bool enabled;
+    double maxDistance;
+
+private:
+    unsigned int frameNumber;
+    bool counted;
+    int drawnModels;
+};
+
 Vizkit3dWorld::Vizkit3dWorld(std::string path,
                             std::vector<std::string> modelPaths,
                             std::vector<std::string> ignoredModels,
@@ -35,6 +113,10 @@ Vizkit3dWorld::Vizkit3dWorld(std::string path,
     , zNear(zNear)
     , zFar(zFar)
     , horizontalFov(horizontalFov)
+    , cullingEnabled(false)
+    , cullDistance(0.0)
+    , lodDistance(0.0)
+    , cullCallback(new ModelCullCallback())
 {
     if (!qApp) new QApplication(argc, argv);
 
@@ -56,6 +138,7 @@ Vizkit3dWorld::Vizkit3dWorld(std::string path,
     //It is necessary to create the vizkit3d plugins in the same thread of QApplication
     loadFromFile(worldPath);
     attachPlugins();
+    attachCullCallbacks();
 
     //apply the tranformations in each model
     applyTransformations();
@@ -66,8 +149,8 @@ Vizkit3dWorld::Vizkit3dWorld(std::string path,
 Vizkit3dWorld::~Vizkit3dWorld()
 {
     delete widget;
-    toSdfElement.clear();
-    robotVizMap.clear();
+    robotVizs.clear();
+    modelStates.clear();
 }
 
 void Vizkit3dWorld::loadFromFile(std::string path) {
@@ -133,18 +216,28 @@ void Vizkit3dWorld::makeWorld(sdf::ElementPtr sdf, std::string version) {
              * but it is necessary to change control/kdl_parser
              * and control/sdf_ruby to change the base segment name
              */
-            if (robotVizMap.find(modelName) == robotVizMap.end()){
+            if (modelStates.getId(modelName) == ModelStates::INVALID_ID){
                 robotVizCountMap.insert(std::make_pair(modelName, 0));
             }
             else {
-                std::ostringstream buf;
-                buf << modelName << "_" << (robotVizCountMap[modelName]++);
-                modelName = buf.str();
+                //the generated name can be used by another model of the world, e.g. a_0, a, a
+                std::string baseName = modelName;
+                do {
+                    std::ostringstream buf;
+                    buf << baseName << "_" << (robotVizCountMap[baseName]++);
+                    modelName = buf.str();
+                } while (modelStates.getId(modelName) != ModelStates::INVALID_ID);
             }
 
             if(std::find(ignoredModels.begin(), ignoredModels.end(), modelName) == ignoredModels.end()){
                 vizkit3d::RobotVisualization* robotViz = robotVizFromSdfModel(modelElem, modelName, version);
-                robotVizMap.insert(std::make_pair(modelName, robotViz));
+
+                //only the pose is kept, the sdf elements are released after the world is loaded
+                sdf::Pose pose = modelElem->GetElement("pose")->Get<sdf::Pose>();
+                modelStates.addModel(modelName,
+                                     base::Position(pose.pos.x, pose.pos.y, pose.pos.z),
+                                     base::Orientation(pose.rot.w, pose.rot.x, pose.rot.y, pose.rot.z));
+                robotVizs.push_back(robotViz);
             }
 
             modelElem = modelElem->GetNextElement("model");
@@ -167,57 +260,67 @@ vizkit3d::RobotVisualization* Vizkit3dWorld::robotVizFromSdfModel(sdf::ElementPt
     robotViz->setPluginName(modelName.c_str());
     robotViz->relocateRoot(modelName);
 
-    toSdfElement.insert(std::make_pair(modelName, sdf_model));
-
-
     return robotViz;
 }
 
 RobotVizMap Vizkit3dWorld::getRobotVizMap() {
+    RobotVizMap robotVizMap;
+    for (size_t id = 0; id < robotVizs.size(); id++){
+        robotVizMap.insert(std::make_pair(modelStates.getName(id), robotVizs[id]));
+    }
     return robotVizMap;
 }
 
 void Vizkit3dWorld::attachPlugins()
 {
-    for (RobotVizMap::iterator it = robotVizMap.begin(); it != robotVizMap.end(); it++){
-        widget->addPlugin(it->second);
-        it->second->setParent(widget);
+    for (size_t id = 0; id < robotVizs.size(); id++){
+        widget->addPlugin(robotVizs[id]);
+        robotVizs[id]->setParent(widget);
         //it is necessary to add to widget first and set the parent widget
-        it->second->setVisualizationFrame(it->first.c_str());
+        robotVizs[id]->setVisualizationFrame(modelStates.getName(id).c_str());
     }
 }
 
 vizkit3d::RobotVisualization* Vizkit3dWorld::getRobotViz(std::string name)
 {
-    RobotVizMap::iterator robotviz_it = robotVizMap.find(name);
-    return (robotviz_it == robotVizMap.end()) ? NULL : robotviz_it->second;
+    size_t id = modelStates.getId(name);
+    return (id == ModelStates::INVALID_ID) ? NULL : robotVizs[id];
 }
 
 void Vizkit3dWorld::setJoints(std::string modelName, base::samples::Joints joints) {
-    vizkit3d::RobotVisualization *viz;
-    if ((viz = getRobotViz(modelName)) != NULL) {
-        viz->updateData(joints);
+    size_t id = modelStates.getId(modelName);
+    if (id != ModelStates::INVALID_ID) {
+        setJoints(id, joints);
     }
 }
 
-sdf::ElementPtr Vizkit3dWorld::getSdfElement(std::string name) {
-    std::map<std::string, sdf::ElementPtr>::iterator it = toSdfElement.find(name);
-    return (it == toSdfElement.end()) ? sdf::ElementPtr() : it->second;
-}
+void Vizkit3dWorld::setJoints(size_t modelId, const base::samples::Joints& joints) {
+    if (modelId >= robotVizs.size()) {
+        throw std::out_of_range("invalid model id");
+    }
 
-void Vizkit3dWorld::applyTransformations() {
+    modelStates.setJointPositions(modelId, joints);
+    robotVizs[modelId]->updateData(joints);
+}
 
-    for (RobotVizMap::iterator it = robotVizMap.begin();
-            it != robotVizMap.end(); it++){
+void Vizkit3dWorld::setModelPose(size_t modelId, const base::Position& position, const base::Orientation& orientation) {
+    modelStates.setPose(modelId, position, orientation);
+    applyTransformation(worldName, modelStates.getName(modelId), position, orientation);
+}
 
-        sdf::ElementPtr sdfModel = getSdfElement(it->first);
+void Vizkit3dWorld::setModelPoses(const std::vector<base::Position>& positions, const std::vector<base::Orientation>& orientations) {
+    modelStates.setPoses(positions, orientations);
+    applyTransformations();
+}
 
-        sdf::Pose pose =  sdfModel->GetElement("pose")->Get<sdf::Pose>();
+void Vizkit3dWorld::applyTransformations() {
 
-        applyTransformation(worldName, it->first,
-                            QVector3D(pose.pos.x, pose.pos.y, pose.pos.z),
-                            QQuaternion(pose.rot.w, pose.rot.x, pose.rot.y, pose.rot.z));
+    const std::vector<std::string>& names = modelStates.getNames();
+    const std::vector<base::Position>& positions = modelStates.getPositions();
+    const std::vector<base::Orientation>& orientations = modelStates.getOrientations();
 
+    for (size_t id = 0; id < modelStates.size(); id++){
+        applyTransformation(worldName, names[id], positions[id], orientations[id]);
     }
 }
 
@@ -254,6 +357,13 @@ void Vizkit3dWorld::applyTransformation(std::string targetFrame, std::string sou
 
 
 void Vizkit3dWorld::setTransformation(base::samples::RigidBodyState rbs) {
+    size_t id = modelStates.getId(rbs.sourceFrame);
+
+    //keep the model pose in the world up to date
+    if (id != ModelStates::INVALID_ID && rbs.targetFrame == worldName) {
+        modelStates.setPose(id, rbs.position, rbs.orientation);
+    }
+
     applyTransformation(rbs);
 }
 
@@ -295,6 +405,57 @@ void Vizkit3dWorld::grabFrame(base::samples::frame::Frame& frame)
     cvtQImageToFrame(image, frame, (widget->isVisible() && !widget->isMinimized()));
 }
 
+void Vizkit3dWorld::grabFrame(base::samples::frame::Frame& frame, const GrabOptions& options)
+{
+    /**
+     * the scale must be a power of two fraction, each level halves the resolution
+     */
+    int scaleLevels = 0;
+    double levelScale = 1.0;
+    while (levelScale > options.scale && scaleLevels < 16) {
+        levelScale /= 2.0;
+        scaleLevels++;
+    }
+
+    if (options.scale <= 0.0 || levelScale != options.scale) {
+        throw std::invalid_argument("the grab scale must be 1, 1/2, 1/4, ...");
+    }
+
+    QImage image = grabImage();
+    bool flipImage = (widget->isVisible() && !widget->isMinimized());
+
+    //the region of interest in the camera resolution
+    int factor = 1 << scaleLevels;
+    QRect roi = (options.roi.isNull()) ? QRect() : QRect(options.roi.x() * factor, options.roi.y() * factor,
+                                                         options.roi.width() * factor, options.roi.height() * factor);
+    QRect rect = roiToImageRect(image.rect(), roi, flipImage);
+
+    //the box reduction is done by the conversion kernel
+    if (options.frameMode == base::samples::frame::MODE_UNDEFINED) {
+        cvtQImageToFrame(image, frame, flipImage, rect, scaleLevels);
+    }
+    else {
+        cvtQImageToFrame(image, frame, options.frameMode, flipImage, rect, scaleLevels);
+    }
+}
+
+void Vizkit3dWorld::grabFrame(base::samples::frame::Frame& frame,
+                              std::vector<base::samples::frame::Frame>& pyramid,
+                              const GrabOptions& options)
+{
+    if (options.pyramidLevels < 0) {
+        throw std::invalid_argument("the number of pyramid levels must not be negative");
+    }
+
+    //the pyramid levels are downsampled from the frame, so the frame can not be a bayer mosaic
+    if (options.pyramidLevels > 0 && isBayerMode(options.frameMode)) {
+        throw std::invalid_argument("the pyramid levels are not supported with bayer frame modes");
+    }
+
+    grabFrame(frame, options);
+    buildFramePyramid(frame, pyramid, options.pyramidLevels);
+}
+
 void Vizkit3dWorld::setCameraParams(int cameraWidth, int cameraHeight, double horizontalFov, double zNear, double zFar) {
     this->cameraWidth = cameraWidth;
     this->cameraHeight = cameraHeight;
@@ -302,6 +463,7 @@ void Vizkit3dWorld::setCameraParams(int cameraWidth, int cameraHeight, double ho
     this->zNear = zNear;
     this->zFar = zFar;
     applyCameraParams();
+    applyCullingParams();
 }
 
 void Vizkit3dWorld::applyCameraParams() {
@@ -310,4 +472,88 @@ void Vizkit3dWorld::applyCameraParams() {
     widget->getView(0)->getCamera()->setProjectionMatrixAsPerspective(osg::RadiansToDegrees(fovy), aspectRatio, zNear, zFar);
 }
 
+void Vizkit3dWorld::setCullingParams(bool enabled, double cullDistance) {
+    this->cullingEnabled = enabled;
+    this->cullDistance = cullDistance;
+    applyCullingParams();
+}
+
+void Vizkit3dWorld::applyCullingParams() {
+    cullCallback->enabled = cullingEnabled;
+    cullCallback->maxDistance = (cullDistance > 0.0) ? cullDistance : zFar;
+}
+
+void Vizkit3dWorld::attachCullCallbacks() {
+    applyCullingParams();
+
+    for (size_t id = 0; id < robotVizs.size(); id++){
+        robotVizs[id]->getRootNode()->addCullCallback(cullCallback);
+    }
+}
+
+int Vizkit3dWorld::getDrawnModels() const {
+    const osg::FrameStamp *frameStamp = widget->getView(0)->getFrameStamp();
+    return (frameStamp) ? cullCallback->getDrawnModels(frameStamp->getFrameNumber()) : 0;
+}
+
+int Vizkit3dWorld::getCulledModels() const {
+    const osg::FrameStamp *frameStamp = widget->getView(0)->getFrameStamp();
+    return (frameStamp) ? static_cast<int>(robotVizs.size()) - getDrawnModels() : 0;
+}
+
+void Vizkit3dWorld::setLodParams(double lodDistance, float sampleRatio) {
+    if (lodDistance > 0.0 && lodNodes.empty()) {
+        if (sampleRatio <= 0.0f || sampleRatio >= 1.0f) {
+            throw std::invalid_argument("the level of detail sample ratio must be in the interval (0, 1)");
+        }
+
+        makeLods(sampleRatio);
+    }
+
+    this->lodDistance = lodDistance;
+
+    /**
+     * the coarser meshes are kept, only the ranges are changed
+     */
+    float range = (lodDistance > 0.0) ? static_cast<float>(lodDistance) : FLT_MAX;
+    for (size_t i = 0; i < lodNodes.size(); i++) {
+        lodNodes[i]->setRange(0, 0.0f, range);
+        lodNodes[i]->setRange(1, range, FLT_MAX);
+    }
+}
+
+void Vizkit3dWorld::makeLods(float sampleRatio) {
+    for (size_t id = 0; id < robotVizs.size(); id++){
+        GeodeCollector collector;
+        robotVizs[id]->getRootNode()->accept(collector);
+
+        for (std::set<osg::Geode*>::iterator geode_it = collector.geodes.begin();
+                geode_it != collector.geodes.end(); geode_it++){
+
+            osg::ref_ptr<osg::Geode> geode = *geode_it;
+
+            //the geometries are copied and the state sets are shared with the original mesh
+            osg::ref_ptr<osg::Geode> coarse = static_cast<osg::Geode*>(geode->clone(
+                osg::CopyOp::DEEP_COPY_DRAWABLES | osg::CopyOp::DEEP_COPY_PRIMITIVES | osg::CopyOp::DEEP_COPY_ARRAYS));
+
+            osgUtil::Simplifier simplifier(sampleRatio);
+            coarse->accept(simplifier);
+
+            osg::ref_ptr<osg::LOD> lod = new osg::LOD();
+            lod->addChild(geode, 0.0f, FLT_MAX);
+            lod->addChild(coarse, FLT_MAX, FLT_MAX);
+
+            //the parents list is copied because replaceChild changes it
+            osg::Node::ParentList parents = geode->getParents();
+            for (osg::Node::ParentList::iterator parent_it = parents.begin(); parent_it != parents.end(); parent_it++){
+                if (*parent_it != lod.get()) {
+                    (*parent_it)->replaceChild(geode, lod);
+                }
+            }
+
+            lodNodes.push_back(lod);
+        }
+    }
+}
+
 }
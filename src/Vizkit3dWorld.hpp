@@ -14,12 +14,55 @@
 #include <vizkit3d/Vizkit3DWidget.hpp>
 #include <vizkit3d/RobotVisualization.hpp>
 #include <base/samples/Frame.hpp>
+#include <osg/LOD>
+#include <vizkit3d_world/ModelStates.hpp>
 #include <map>
 
 namespace vizkit3d_world {
 
+class ModelCullCallback;
+
 typedef std::map<std::string, vizkit3d::RobotVisualization*> RobotVizMap;
 
+/**
+ * GrabOptions
+ * reduce the number of pixels written by grabFrame
+ * the scene is always rendered and read back by Vizkit3DWidget::grab in the camera resolution,
+ * so these options save no render or readback cost
+ */
+struct GrabOptions {
+    /**
+     * fraction of the camera resolution of the grabbed frame: 1, 1/2, 1/4, ...
+     * the box reduction is done while the pixels are converted
+     */
+    double scale;
+
+    /**
+     * region of interest in pixels of the scaled image
+     * only the pixels inside the region are converted, a null rect means the whole image
+     */
+    QRect roi;
+
+    /**
+     * number of pyramid levels, each level has half of the resolution of the previous one
+     */
+    int pyramidLevels;
+
+    /**
+     * frame mode of the grabbed frame: MODE_RGB, MODE_BGR, MODE_RGB32, MODE_GRAYSCALE or bayer
+     * bayer modes can be reduced by scale, but they can not be used with pyramid levels
+     * MODE_RGB32 pixels are stored as r, g, b, a bytes
+     * MODE_UNDEFINED means the mode is defined by the grabbed image format
+     */
+    base::samples::frame::frame_mode_t frameMode;
+
+    GrabOptions()
+        : scale(1.0)
+        , roi()
+        , pyramidLevels(0)
+        , frameMode(base::samples::frame::MODE_UNDEFINED) {}
+};
+
 /**
  * Vizkit3dWorld
  * set up vizkit3d instance from SDF
@@ -45,8 +88,27 @@ public:
      */
     virtual ~Vizkit3dWorld();
 
+    /**
+     * Build a map with the vizkit3d::RobotVisualization of each model
+     * the map is built in each call, so it should be used only at setup time
+     *
+     * @return RobotVizMap: the vizkit3d::RobotVisualization using the model name as key
+     */
     RobotVizMap getRobotVizMap();
 
+    /**
+     * @return ModelStates: the models state arrays indexed by the model id
+     */
+    const ModelStates& getModelStates() const { return modelStates; }
+
+    /**
+     * Return the model id by name
+     *
+     * @param modelName the model name
+     * @return size_t: the model id or ModelStates::INVALID_ID if the model is not found
+     */
+    size_t getModelId(std::string modelName) const { return modelStates.getId(modelName); }
+
     /**
      * set joints states
      *
@@ -55,6 +117,31 @@ public:
      */
     void setJoints(std::string modelName, base::samples::Joints joints);
 
+    /**
+     * set joints states
+     *
+     * @param modelId the model id
+     * @param joints the vector with joints states
+     */
+    void setJoints(size_t modelId, const base::samples::Joints& joints);
+
+    /**
+     * set model pose in the world
+     *
+     * @param modelId the model id
+     * @param position the model position
+     * @param orientation the model orientation
+     */
+    void setModelPose(size_t modelId, const base::Position& position, const base::Orientation& orientation);
+
+    /**
+     * set the pose in the world of every model
+     *
+     * @param positions the positions indexed by the model id
+     * @param orientations the orientations indexed by the model id
+     */
+    void setModelPoses(const std::vector<base::Position>& positions, const std::vector<base::Orientation>& orientations);
+
     /**
      * set models transformations using vizkit3d setTransformation
      *
@@ -104,9 +191,62 @@ public:
      */
     void grabFrame(base::samples::frame::Frame& frame);
 
+    /**
+     * grab a reduced resolution or a region of interest frame from vizkit3d
+     *
+     * @param frame: receives the frame rendered by vizkit3d
+     * @param options: the scale, the region of interest and the frame mode
+     */
+    void grabFrame(base::samples::frame::Frame& frame, const GrabOptions& options);
+
+    /**
+     * grab frame and image pyramid from vizkit3d
+     *
+     * @param frame: receives the frame rendered by vizkit3d
+     * @param pyramid: receives options.pyramidLevels downsampled frames
+     * @param options: the scale, the region of interest, the frame mode and the number of pyramid levels
+     */
+    void grabFrame(base::samples::frame::Frame& frame,
+                   std::vector<base::samples::frame::Frame>& pyramid,
+                   const GrabOptions& options);
+
 
      void setCameraParams(int cameraWidth, int cameraHeight, double horizontalFov, double zNear, double zFar);
 
+    /**
+     * set culling parameters
+     * models outside the camera view are always culled by osg,
+     * models farther than cullDistance are culled if culling is enabled,
+     * distance culling is disabled by default
+     *
+     * @param enabled: enable distance culling if true
+     * @param cullDistance: the maximum distance from camera to the model bound, if it is
+     * less or equal to zero, then zFar is used
+     */
+    void setCullingParams(bool enabled, double cullDistance = 0.0);
+
+    /**
+     * set level of detail parameters
+     * a coarser mesh is generated for each model mesh in the first call with lodDistance
+     * greater than zero and it is drawn when the mesh is farther than lodDistance
+     *
+     * @param lodDistance: the distance from camera where the coarser meshes are used,
+     * if it is less or equal to zero, then the coarser meshes are not used
+     * @param sampleRatio: ratio of the vertices kept in the coarser meshes, in (0, 1),
+     * it is only used when the meshes are generated, so it is fixed after the first build
+     */
+    void setLodParams(double lodDistance, float sampleRatio = 0.25f);
+
+    /**
+     * @return int: the number of models drawn in the last rendered frame
+     */
+    int getDrawnModels() const;
+
+    /**
+     * @return int: the number of models culled in the last rendered frame
+     */
+    int getCulledModels() const;
+
 protected:
 
     /**
@@ -161,15 +301,7 @@ protected:
     void makeWorld(sdf::ElementPtr sdf, std::string version);
 
     /**
-     * Get sdf model element by the model name
-     *
-     * @param name the model name
-     * @return sdf::ElementPtr with the model sdf element
-     */
-    sdf::ElementPtr getSdfElement(std::string name);
-
-    /**
-     * Apply transformation in the each model of the scene
+     * Apply transformation in the each model of the scene using the poses stored in modelStates
      */
     void applyTransformations();
 
@@ -205,21 +337,37 @@ protected:
 
     void applyCameraParams();
 
+    /**
+     * Attach the cull callback to the root node of each model
+     */
+    void attachCullCallbacks();
+
+    /**
+     * Apply the culling parameters to the cull callback
+     */
+    void applyCullingParams();
+
+    /**
+     * Insert the coarser meshes in each model
+     *
+     * @param sampleRatio: ratio of the vertices kept in the coarser meshes
+     */
+    void makeLods(float sampleRatio);
+
 
     QImage grabbedImage; //image grabbed
 
     std::string worldPath; //path to sdf file that describe the scene
     std::string worldName; //stores the world name
 
-    RobotVizMap robotVizMap; //stores the vizkit3d::RobotVisualization and uses the model name as key
+    ModelStates modelStates; //stores the state of each model indexed by the model id
+    std::vector<vizkit3d::RobotVisualization*> robotVizs; //stores the vizkit3d::RobotVisualization indexed by the model id
     vizkit3d::Vizkit3DWidget *widget; //this widget stores and manage the robot models plugins
 
     std::vector<std::string> modelPaths; //stores paths with gazebo models
 
     std::vector<std::string> ignoredModels; //list of sdf that will be ignored by the robot visualization
 
-    std::map<std::string, sdf::ElementPtr> toSdfElement; //map sdf element using model name
-
     /**
      * Camera parameters
      */
@@ -229,6 +377,15 @@ protected:
     double zFar;
     double horizontalFov;
 
+    /**
+     * Culling and level of detail parameters
+     */
+    bool cullingEnabled;
+    double cullDistance;
+    double lodDistance;
+    std::vector<osg::ref_ptr<osg::LOD> > lodNodes; //level of detail nodes inserted in the models
+    osg::ref_ptr<ModelCullCallback> cullCallback; //distance culling and counters shared by every model
+
 };
 
 }
@@ -0,0 +1,177 @@
+/*
+ * benchmarkModelStates.cpp
+ *
+ * Compare the previous scene state layout (model name maps and the sdf DOM)
+ * with ModelStates: memory, pose iteration and snapshot
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <malloc.h>
+#include <sdf/sdf.hh>
+#include <base/Time.hpp>
+#include <vizkit3d/RobotVisualization.hpp>
+#include <vizkit3d_world/ModelStates.hpp>
+
+using namespace vizkit3d_world;
+
+typedef std::map<std::string, vizkit3d::RobotVisualization*> RobotVizMap;
+
+/**
+ * the layout used before ModelStates, the sdf DOM is kept alive by toSdfElement
+ */
+struct MapStates {
+    RobotVizMap robotVizMap;
+    std::map<std::string, sdf::ElementPtr> toSdfElement;
+};
+
+/**
+ * ModelStates and the RobotVisualization indexed by the model id
+ */
+struct DenseStates {
+    ModelStates modelStates;
+    std::vector<vizkit3d::RobotVisualization*> robotVizs;
+};
+
+static size_t heapBytes()
+{
+    return mallinfo().uordblks;
+}
+
+static std::string makeWorldString(int totalModels)
+{
+    std::ostringstream xml;
+    xml << "<sdf version='1.4'><world name='benchmark'>";
+    for (int i = 0; i < totalModels; i++) {
+        xml << "<model name='model_" << i << "'><static>true</static>"
+            << "<pose>" << i << " 0 0 0 0 0</pose>"
+            << "<link name='link'><visual name='visual'><geometry><box><size>1 1 1</size></box></geometry></visual></link>"
+            << "</model>";
+    }
+    xml << "</world></sdf>";
+    return xml.str();
+}
+
+static sdf::ElementPtr loadWorld(const std::string& xml, sdf::SDFPtr& sdf)
+{
+    sdf.reset(new sdf::SDF);
+    if (!sdf::init(sdf) || !sdf::readString(xml, sdf)) {
+        throw std::runtime_error("unable to load the benchmark world");
+    }
+    return sdf->root->GetElement("world");
+}
+
+static void loadMapStates(const std::string& xml, MapStates& states)
+{
+    sdf::SDFPtr sdf;
+    sdf::ElementPtr modelElem = loadWorld(xml, sdf)->GetElement("model");
+    while (modelElem) {
+        std::string name = modelElem->Get<std::string>("name");
+        states.robotVizMap.insert(std::make_pair(name, static_cast<vizkit3d::RobotVisualization*>(NULL)));
+        states.toSdfElement.insert(std::make_pair(name, modelElem));
+        modelElem = modelElem->GetNextElement("model");
+    }
+}
+
+static void loadDenseStates(const std::string& xml, DenseStates& states)
+{
+    sdf::SDFPtr sdf;
+    sdf::ElementPtr modelElem = loadWorld(xml, sdf)->GetElement("model");
+    while (modelElem) {
+        sdf::Pose pose = modelElem->GetElement("pose")->Get<sdf::Pose>();
+        states.modelStates.addModel(modelElem->Get<std::string>("name"),
+                                    base::Position(pose.pos.x, pose.pos.y, pose.pos.z),
+                                    base::Orientation(pose.rot.w, pose.rot.x, pose.rot.y, pose.rot.z));
+        states.robotVizs.push_back(NULL);
+        modelElem = modelElem->GetNextElement("model");
+    }
+}
+
+/**
+ * the pose iteration of applyTransformations before ModelStates
+ */
+static double iterateMapStates(MapStates& states)
+{
+    double sum = 0.0;
+    for (RobotVizMap::iterator it = states.robotVizMap.begin(); it != states.robotVizMap.end(); it++) {
+        sdf::ElementPtr sdfModel = states.toSdfElement.find(it->first)->second;
+        sdf::Pose pose = sdfModel->GetElement("pose")->Get<sdf::Pose>();
+        sum += pose.pos.x + pose.rot.w;
+    }
+    return sum;
+}
+
+/**
+ * the pose iteration of applyTransformations with ModelStates
+ */
+static double iterateDenseStates(const DenseStates& states)
+{
+    const std::vector<base::Position>& positions = states.modelStates.getPositions();
+    const std::vector<base::Orientation>& orientations = states.modelStates.getOrientations();
+
+    double sum = 0.0;
+    for (size_t id = 0; id < states.modelStates.size(); id++) {
+        sum += positions[id].x() + orientations[id].w();
+    }
+    return sum;
+}
+
+int main(int argc, char** argv)
+{
+    int totalModels = (argc > 1) ? atoi(argv[1]) : 1000;
+    int repetitions = (argc > 2) ? atoi(argv[2]) : 100;
+
+    std::string xml = makeWorldString(totalModels);
+
+    /**
+     * memory retained after the world is loaded
+     */
+    size_t start = heapBytes();
+    MapStates *mapStates = new MapStates();
+    loadMapStates(xml, *mapStates);
+    size_t mapBytes = heapBytes() - start;
+
+    start = heapBytes();
+    DenseStates *denseStates = new DenseStates();
+    loadDenseStates(xml, *denseStates);
+    size_t denseBytes = heapBytes() - start;
+
+    /**
+     * pose iteration and snapshot
+     */
+    double checksum = 0.0;
+
+    base::Time time = base::Time::now();
+    for (int i = 0; i < repetitions; i++) checksum += iterateMapStates(*mapStates);
+    base::Time mapIteration = (base::Time::now() - time) / repetitions;
+
+    time = base::Time::now();
+    for (int i = 0; i < repetitions; i++) checksum += iterateDenseStates(*denseStates);
+    base::Time denseIteration = (base::Time::now() - time) / repetitions;
+
+    time = base::Time::now();
+    for (int i = 0; i < repetitions; i++) {
+        RobotVizMap snapshot = mapStates->robotVizMap;
+        checksum += snapshot.size();
+    }
+    base::Time mapSnapshot = (base::Time::now() - time) / repetitions;
+
+    time = base::Time::now();
+    for (int i = 0; i < repetitions; i++) {
+        ModelStates snapshot = denseStates->modelStates;
+        checksum += snapshot.size();
+    }
+    base::Time denseSnapshot = (base::Time::now() - time) / repetitions;
+
+    std::cout << "models: " << totalModels << ", repetitions: " << repetitions << ", checksum: " << checksum << std::endl;
+    std::cout << "layout        memory (bytes)  iteration (us)  snapshot (us)" << std::endl;
+    std::cout << "map + sdf DOM " << mapBytes << "  " << mapIteration.toMicroseconds() << "  " << mapSnapshot.toMicroseconds() << std::endl;
+    std::cout << "ModelStates   " << denseBytes << "  " << denseIteration.toMicroseconds() << "  " << denseSnapshot.toMicroseconds() << std::endl;
+    std::cout << "ModelStates::memoryUsage " << denseStates->modelStates.memoryUsage() << " bytes" << std::endl;
+
+    delete mapStates;
+    delete denseStates;
+
+    return 0;
+}
@@ -1,5 +1,9 @@
 #include <boost/test/unit_test.hpp>
 #include <vizkit3d_world/Vizkit3dWorld.hpp>
+#include <vizkit3d_world/Utils.hpp>
+#include <vizkit3d_world/ModelStates.hpp>
+#include <osg/LOD>
+#include <osg/NodeVisitor>
 #include <QString>
 
 using namespace vizkit3d_world;
@@ -8,3 +12,286 @@ BOOST_AUTO_TEST_CASE(it_should_not_crash_when_welcome_is_called)
 {
     vizkit3d_world::Vizkit3dWorld vizkit3d_world;
 }
+
+/**
+ * Count the level of detail nodes of a subtree
+ */
+class LodCounter : public osg::NodeVisitor {
+public:
+    LodCounter()
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+        , count(0) {}
+
+    void apply(osg::LOD& lod) {
+        count++;
+        traverse(lod);
+    }
+
+    int count;
+};
+
+BOOST_AUTO_TEST_CASE(it_should_not_count_models_in_empty_world)
+{
+    vizkit3d_world::Vizkit3dWorld world(TEST_DATA_PATH "empty.world");
+    world.setCullingParams(true, 10.0);
+    world.enableGrabbing();
+    world.grabImage();
+
+    BOOST_CHECK_EQUAL(world.getDrawnModels(), 0);
+    BOOST_CHECK_EQUAL(world.getCulledModels(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_cull_models_outside_camera_view_and_distance)
+{
+    vizkit3d_world::Vizkit3dWorld world(TEST_DATA_PATH "culling.world");
+    world.enableGrabbing();
+
+    base::samples::RigidBodyState cameraPose;
+    cameraPose.position = base::Position::Zero();
+    cameraPose.orientation = base::Orientation::Identity();
+    world.setCameraPose(cameraPose);
+
+    /**
+     * without distance culling only the model behind the camera is culled
+     */
+    world.grabImage();
+    BOOST_CHECK_EQUAL(world.getDrawnModels(), 2);
+    BOOST_CHECK_EQUAL(world.getCulledModels(), 1);
+
+    world.setCullingParams(true, 100.0);
+    world.grabImage();
+    BOOST_CHECK_EQUAL(world.getDrawnModels(), 1);
+    BOOST_CHECK_EQUAL(world.getCulledModels(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_insert_lod_nodes_in_models)
+{
+    vizkit3d_world::Vizkit3dWorld world(TEST_DATA_PATH "culling.world");
+    RobotVizMap robotVizMap = world.getRobotVizMap();
+
+    LodCounter before;
+    robotVizMap["near_box"]->getRootNode()->accept(before);
+    BOOST_CHECK_EQUAL(before.count, 0);
+
+    world.setLodParams(10.0, 0.5f);
+
+    LodCounter after;
+    robotVizMap["near_box"]->getRootNode()->accept(after);
+    BOOST_CHECK_GT(after.count, 0);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_validate_lod_sample_ratio_only_when_meshes_are_generated)
+{
+    vizkit3d_world::Vizkit3dWorld world(TEST_DATA_PATH "culling.world");
+    BOOST_CHECK_THROW(world.setLodParams(10.0, 0.0f), std::invalid_argument);
+    BOOST_CHECK_THROW(world.setLodParams(10.0, 1.0f), std::invalid_argument);
+    BOOST_CHECK_NO_THROW(world.setLodParams(0.0, 0.0f));
+    BOOST_CHECK_NO_THROW(world.setLodParams(10.0, 0.5f));
+
+    //the meshes are generated, so the ratio is not used anymore
+    BOOST_CHECK_NO_THROW(world.setLodParams(20.0, 0.0f));
+}
+
+BOOST_AUTO_TEST_CASE(it_should_reject_bayer_pyramid_before_grabbing)
+{
+    vizkit3d_world::Vizkit3dWorld world(TEST_DATA_PATH "empty.world");
+
+    GrabOptions options;
+    options.frameMode = base::samples::frame::MODE_BAYER_RGGB;
+    options.pyramidLevels = 1;
+
+    base::samples::frame::Frame frame;
+    std::vector<base::samples::frame::Frame> pyramid;
+    BOOST_CHECK_THROW(world.grabFrame(frame, pyramid, options), std::invalid_argument);
+    BOOST_CHECK_EQUAL(frame.image.size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_downsample_frame_to_half_resolution)
+{
+    base::samples::frame::Frame frame(4, 2, 8, base::samples::frame::MODE_BGR);
+    for (size_t i = 0; i < frame.image.size(); i++) {
+        frame.image[i] = i % 2 ? 10 : 20;
+    }
+
+    std::vector<base::samples::frame::Frame> pyramid;
+    buildFramePyramid(frame, pyramid, 1);
+
+    BOOST_REQUIRE_EQUAL(pyramid.size(), 1u);
+    BOOST_CHECK_EQUAL(pyramid[0].getWidth(), 2);
+    BOOST_CHECK_EQUAL(pyramid[0].getHeight(), 1);
+    BOOST_CHECK_EQUAL(pyramid[0].getFrameMode(), base::samples::frame::MODE_BGR);
+    BOOST_CHECK_EQUAL(pyramid[0].image[0], 15);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_not_build_pyramid_with_negative_levels)
+{
+    base::samples::frame::Frame frame(4, 2, 8, base::samples::frame::MODE_BGR);
+    std::vector<base::samples::frame::Frame> pyramid;
+    BOOST_CHECK_THROW(buildFramePyramid(frame, pyramid, -1), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_convert_region_of_interest_of_flipped_qimage)
+{
+    /**
+     * 4x4 grayscale image, each pixel value is the row * 10 + column
+     */
+    QImage image(4, 4, QImage::Format_Indexed8);
+    for (int y = 0; y < image.height(); y++) {
+        for (int x = 0; x < image.width(); x++) {
+            image.scanLine(y)[x] = y * 10 + x;
+        }
+    }
+
+    /**
+     * the rows are stored bottom up, so the roi top row is the image row 2
+     */
+    QRect rect = roiToImageRect(image.rect(), QRect(1, 0, 2, 2), true);
+    BOOST_CHECK(rect == QRect(1, 2, 2, 2));
+
+    base::samples::frame::Frame frame;
+    cvtQImageToFrame(image, frame, true, rect);
+    BOOST_REQUIRE_EQUAL(frame.getWidth(), 2u);
+    BOOST_REQUIRE_EQUAL(frame.getHeight(), 2u);
+    BOOST_CHECK_EQUAL(frame.image[0], 31);
+    BOOST_CHECK_EQUAL(frame.image[1], 32);
+    BOOST_CHECK_EQUAL(frame.image[2], 21);
+    BOOST_CHECK_EQUAL(frame.image[3], 22);
+
+    /**
+     * the rows are stored top down
+     */
+    rect = roiToImageRect(image.rect(), QRect(1, 0, 2, 2), false);
+    BOOST_CHECK(rect == QRect(1, 0, 2, 2));
+
+    BOOST_CHECK_THROW(roiToImageRect(image.rect(), QRect(3, 3, 2, 2), false), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_reduce_qimage_while_converting)
+{
+    /**
+     * 4x2 image, the left 2x2 block is black and the right one is white
+     */
+    QImage image(4, 2, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); y++) {
+        for (int x = 0; x < image.width(); x++) {
+            image.setPixel(x, y, (x < 2) ? qRgb(0, 0, 0) : qRgb(200, 100, 40));
+        }
+    }
+
+    base::samples::frame::Frame frame;
+    cvtQImageToFrame(image, frame, base::samples::frame::MODE_RGB, false, QRect(), 1);
+    BOOST_REQUIRE_EQUAL(frame.getWidth(), 2u);
+    BOOST_REQUIRE_EQUAL(frame.getHeight(), 1u);
+    BOOST_CHECK_EQUAL(frame.image[0], 0);
+    BOOST_CHECK_EQUAL(frame.image[3], 200);
+    BOOST_CHECK_EQUAL(frame.image[4], 100);
+    BOOST_CHECK_EQUAL(frame.image[5], 40);
+
+    /**
+     * the bayer mosaic is sampled from the reduced pixels
+     */
+    cvtQImageToFrame(image, frame, base::samples::frame::MODE_BAYER_RGGB, false, QRect(), 1);
+    BOOST_CHECK_EQUAL(frame.image[0], 0);
+    BOOST_CHECK_EQUAL(frame.image[1], 100);
+
+    BOOST_CHECK_THROW(cvtQImageToFrame(image, frame, base::samples::frame::MODE_RGB, false, QRect(), 2), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_convert_qimage_to_requested_frame_mode)
+{
+    QImage image(2, 2, QImage::Format_RGB32);
+    image.fill(qRgb(10, 20, 30));
+
+    base::samples::frame::Frame frame;
+    cvtQImageToFrame(image, frame, base::samples::frame::MODE_RGB);
+    BOOST_CHECK_EQUAL(frame.getFrameMode(), base::samples::frame::MODE_RGB);
+    BOOST_CHECK_EQUAL(frame.image[0], 10);
+    BOOST_CHECK_EQUAL(frame.image[2], 30);
+
+    cvtQImageToFrame(image, frame, base::samples::frame::MODE_BAYER_RGGB);
+    BOOST_CHECK_EQUAL(frame.image[0], 10);
+    BOOST_CHECK_EQUAL(frame.image[1], 20);
+    BOOST_CHECK_EQUAL(frame.image[3], 30);
+
+    /**
+     * the bytes of MODE_RGB32 are stored as r, g, b, a
+     */
+    cvtQImageToFrame(image, frame, base::samples::frame::MODE_RGB32);
+    BOOST_REQUIRE_EQUAL(frame.image.size(), 16u);
+    BOOST_CHECK_EQUAL(frame.image[0], 10);
+    BOOST_CHECK_EQUAL(frame.image[1], 20);
+    BOOST_CHECK_EQUAL(frame.image[2], 30);
+    BOOST_CHECK_EQUAL(frame.image[3], 255);
+
+    /**
+     * 32 bits images are converted to MODE_BGR by default
+     */
+    cvtQImageToFrame(image, frame);
+    BOOST_CHECK_EQUAL(frame.getFrameMode(), base::samples::frame::MODE_BGR);
+    BOOST_CHECK_EQUAL(frame.image[0], 30);
+    BOOST_CHECK_EQUAL(frame.image[2], 10);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_convert_rgb888_qimage_to_requested_frame_mode)
+{
+    QImage image(2, 2, QImage::Format_RGB888);
+    image.fill(QColor(10, 20, 30));
+
+    /**
+     * QImage::Format_RGB888 stores the bytes as r, g, b
+     */
+    base::samples::frame::Frame frame;
+    cvtQImageToFrame(image, frame);
+    BOOST_CHECK_EQUAL(frame.getFrameMode(), base::samples::frame::MODE_RGB);
+    BOOST_CHECK_EQUAL(frame.image[0], 10);
+    BOOST_CHECK_EQUAL(frame.image[2], 30);
+
+    cvtQImageToFrame(image, frame, base::samples::frame::MODE_BGR);
+    BOOST_CHECK_EQUAL(frame.image[0], 30);
+    BOOST_CHECK_EQUAL(frame.image[1], 20);
+    BOOST_CHECK_EQUAL(frame.image[2], 10);
+
+    cvtQImageToFrame(image, frame, base::samples::frame::MODE_GRAYSCALE);
+    BOOST_CHECK_EQUAL(frame.image[0], (77 * 10 + 150 * 20 + 29 * 30 + 128) >> 8);
+
+    cvtQImageToFrame(image, frame, base::samples::frame::MODE_BAYER_BGGR);
+    BOOST_CHECK_EQUAL(frame.image[0], 30);
+    BOOST_CHECK_EQUAL(frame.image[1], 20);
+    BOOST_CHECK_EQUAL(frame.image[3], 10);
+}
+
+BOOST_AUTO_TEST_CASE(it_should_store_model_states_in_dense_arrays)
+{
+    ModelStates states;
+    BOOST_REQUIRE_EQUAL(states.addModel("first", base::Position::Zero(), base::Orientation::Identity()), 0u);
+    BOOST_REQUIRE_EQUAL(states.addModel("second", base::Position::Zero(), base::Orientation::Identity()), 1u);
+    BOOST_CHECK_THROW(states.addModel("first", base::Position::Zero(), base::Orientation::Identity()), std::invalid_argument);
+
+    BOOST_CHECK_EQUAL(states.size(), 2u);
+    BOOST_CHECK_EQUAL(states.getId("second"), 1u);
+    BOOST_CHECK_EQUAL(states.getId("unknown"), ModelStates::INVALID_ID);
+    BOOST_CHECK_EQUAL(states.getName(1), "second");
+
+    states.setPose(1, base::Position::UnitX(), base::Orientation::Identity());
+    BOOST_CHECK_EQUAL(states.getPositions()[1].x(), 1.0);
+    BOOST_CHECK_THROW(states.setPose(2, base::Position::Zero(), base::Orientation::Identity()), std::out_of_range);
+
+    std::vector<base::Position> positions(2, base::Position::UnitY());
+    std::vector<base::Orientation> orientations(2, base::Orientation::Identity());
+    states.setPoses(positions, orientations);
+    BOOST_CHECK_EQUAL(states.getPositions()[0].y(), 1.0);
+    BOOST_CHECK_EQUAL(states.getPositions()[1].x(), 0.0);
+    positions.pop_back();
+    BOOST_CHECK_THROW(states.setPoses(positions, orientations), std::invalid_argument);
+
+    base::samples::Joints joints = base::samples::Joints::Positions(std::vector<double>(3, 0.5));
+    states.setJointPositions(0, joints);
+    BOOST_REQUIRE_EQUAL(states.getJointPositions(0).size(), 3u);
+    BOOST_CHECK_EQUAL(states.getJointPositions(0)[2], 0.5);
+    BOOST_CHECK_EQUAL(states.getJointPositions(1).size(), 0u);
+
+    ModelStates snapshot = states;
+    states.clear();
+    BOOST_CHECK_EQUAL(states.size(), 0u);
+    BOOST_CHECK_EQUAL(snapshot.getId("first"), 0u);
+}